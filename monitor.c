@@ -1,8 +1,93 @@
 /**
  * 接收RTP 
  */
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
 #include "monitor.h"
 
+/*每个线程一组硬件计数器，cycles为组长，一次read读出全部计数*/
+typedef struct s_dev189_counters
+{
+    int fds[DEV189_COUNTER_LEN];
+    gboolean ok;
+} t_dev189_counters;
+
+static void dev189_counters_free(gpointer data)
+{
+    t_dev189_counters *counters = data;
+    for (int i = 0; i < DEV189_COUNTER_LEN; i++)
+        if (counters->fds[i] >= 0)
+            close(counters->fds[i]);
+    g_free(counters);
+}
+
+static GPrivate thread_counters = G_PRIVATE_INIT(dev189_counters_free);
+
+static t_dev189_counters *dev189_counters_get()
+{
+    t_dev189_counters *counters = g_private_get(&thread_counters);
+    if (counters)
+        return counters;
+
+    counters = g_malloc0(sizeof(t_dev189_counters));
+    for (int i = 0; i < DEV189_COUNTER_LEN; i++)
+        counters->fds[i] = -1;
+#ifdef __linux__
+    const guint64 configs[DEV189_COUNTER_LEN] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+    counters->ok = TRUE;
+    for (int i = 0; i < DEV189_COUNTER_LEN && counters->ok; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.exclude_kernel = 1; // perf_event_paranoid=2时只允许统计用户态
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        /*pid=0,cpu=-1：只统计当前线程*/
+        counters->fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : counters->fds[0], 0);
+        counters->ok = counters->fds[i] >= 0;
+    }
+#endif
+    g_private_set(&thread_counters, counters);
+
+    return counters;
+}
+
+static gboolean dev189_counters_read(guint64 *values)
+{
+    t_dev189_counters *counters = dev189_counters_get();
+    struct
+    {
+        guint64 nr;
+        guint64 values[DEV189_COUNTER_LEN];
+    } group;
+
+    if (!counters->ok)
+        return FALSE;
+    if (read(counters->fds[0], &group, sizeof(group)) != sizeof(group) || group.nr != DEV189_COUNTER_LEN)
+        return FALSE;
+    memcpy(values, group.values, sizeof(group.values));
+
+    return TRUE;
+}
+
+/*当前线程的CPU时间(us)*/
+static gint64 dev189_thread_cpu_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
 t_dev189_monitor *dev189_monitor_new()
 {
     t_dev189_monitor *mon = g_malloc0(sizeof(t_dev189_monitor));
@@ -35,10 +120,14 @@ void dev189_monitor_timer_on(t_dev189_monitor *mon, const char *timer_name)
     t_dev189_timer *timer = (t_dev189_timer *)g_hash_table_lookup(mon->timers, timer_name);
     if (timer)
     {
+        /*线程第一次计时时打开计数器，不计入这次采样*/
+        dev189_counters_get();
         timer->last_start = g_get_monotonic_time();
         if (!timer->start)
             timer->start = timer->last_start;
         timer->counter++;
+        timer->last_cpu_start = dev189_thread_cpu_time();
+        timer->last_counters_ok = dev189_counters_read(timer->last_counters);
     }
 }
 
@@ -47,6 +136,24 @@ void dev189_monitor_timer_off(t_dev189_monitor *mon, const char *timer_name)
     t_dev189_timer *timer = (t_dev189_timer *)g_hash_table_lookup(mon->timers, timer_name);
     if (timer)
     {
+        guint64 counters[DEV189_COUNTER_LEN];
+        gint64 cpu;
+        /*计数器回绕说明on和off不在同一个线程，丢弃这次采样*/
+        if (timer->last_counters_ok && dev189_counters_read(counters))
+        {
+            gboolean valid = TRUE;
+            for (int i = 0; i < DEV189_COUNTER_LEN; i++)
+                valid = valid && counters[i] >= timer->last_counters[i];
+            if (valid)
+            {
+                for (int i = 0; i < DEV189_COUNTER_LEN; i++)
+                    timer->counters[i] += counters[i] - timer->last_counters[i];
+                timer->has_counters = TRUE;
+            }
+        }
+        cpu = dev189_thread_cpu_time() - timer->last_cpu_start;
+        if (cpu >= 0)
+            timer->cpu_elapse += cpu;
         timer->end = g_get_monotonic_time();
         timer->elapse += timer->end - timer->last_start;
     }
@@ -58,8 +165,18 @@ gchar *dev189_monitor_timer_str(t_dev189_monitor *mon, const char *timer_name)
     t_dev189_timer *timer = (t_dev189_timer *)g_hash_table_lookup(mon->timers, timer_name);
     if (timer)
     {
-        g_string_printf(s, "timer=%s elapse=%lld(ms) / %lld(s) times=%u",
+        g_string_printf(s, "timer=%s elapse=%" G_GINT64_FORMAT "(us) / %" G_GINT64_FORMAT "(s) times=%u",
                         timer->name, timer->elapse, timer->elapse / G_USEC_PER_SEC, timer->counter);
+        /*CPU时间远小于elapse说明主要在等待，接近时说明是计算密集*/
+        g_string_append_printf(s, " cpu=%" G_GINT64_FORMAT "(us) cpu/wall=%.1f%%",
+                               timer->cpu_elapse, timer->elapse ? 100.0 * timer->cpu_elapse / timer->elapse : 0.0);
+        if (timer->has_counters)
+            g_string_append_printf(s, " ipc=%.2f cycles=%" G_GUINT64_FORMAT " instructions=%" G_GUINT64_FORMAT " cache_misses=%" G_GUINT64_FORMAT,
+                                   timer->counters[DEV189_COUNTER_CYCLES] ? (double)timer->counters[DEV189_COUNTER_INSTRUCTIONS] / timer->counters[DEV189_COUNTER_CYCLES] : 0.0,
+                                   timer->counters[DEV189_COUNTER_CYCLES], timer->counters[DEV189_COUNTER_INSTRUCTIONS],
+                                   timer->counters[DEV189_COUNTER_CACHE_MISSES]);
+        else
+            g_string_append(s, " ipc=n/a");
     }
     return s->str;
 }
\ No newline at end of file
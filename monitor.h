@@ -3,6 +3,12 @@
  */
 #include <glib/glib.h>
 
+/*硬件计数器，需要内核允许perf_event_open*/
+#define DEV189_COUNTER_CYCLES 0
+#define DEV189_COUNTER_INSTRUCTIONS 1
+#define DEV189_COUNTER_CACHE_MISSES 2
+#define DEV189_COUNTER_LEN 3
+
 /*监控执行情况*/
 typedef struct s_dev189_timer
 {
@@ -10,9 +16,15 @@ typedef struct s_dev189_timer
     gint64 start;
     gint64 end;
     gint64 elapse;
-    uint16_t counter; // 调用的次数
+    uint16_t counter;                    // 调用的次数
+    gint64 cpu_elapse;                   // 线程实际占用的CPU时间，不包括等待
+    guint64 counters[DEV189_COUNTER_LEN]; // 硬件计数器累计值
+    gboolean has_counters;               // 硬件计数器是否可用
     /*below are private fields*/
     gint64 last_start;
+    gint64 last_cpu_start;
+    guint64 last_counters[DEV189_COUNTER_LEN];
+    gboolean last_counters_ok;
 } t_dev189_timer;
 
 typedef struct s_dev189_monitor
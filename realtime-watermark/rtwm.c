@@ -7,30 +7,30 @@
 #include <libavutil/mathematics.h>
 #include <libavutil/time.h>
 
-#include <libavfilter/avfilter.h>
-#include <libavfilter/buffersink.h>
-#include <libavfilter/buffersrc.h>
-
 #include <libavcodec/avcodec.h>
 #include <libavutil/avutil.h>
 #include <libavutil/opt.h>
 
 #include "../monitor.h"
+#include "wmcomp.h"
 
 /*监控执行情况*/
 static t_dev189_monitor *monitor;
-#define monitor_timer_LEN 10
-const char *timers[monitor_timer_LEN] = {"open_input", "open_output", "decode", "read_frame", "filter", "encode", "send_frame", "receive_packet", "write_frame", "usleep"};
+#define monitor_timer_LEN 11
+const char *timers[monitor_timer_LEN] = {"open_input", "open_output", "decode", "read_frame", "filter", "encode", "send_frame", "receive_packet", "write_frame", "usleep_filter", "usleep_encode"};
 
 static AVFormatContext *pFmtCtxIn = NULL, *pFmtCtxOut = NULL;
 static int iVideoStreamIndex = -1;
 static AVStream *pStreamVideoIn;
+/*解码线程关闭输入后filter和encode线程仍然需要*/
+static AVRational time_base_in;
+static AVRational frame_rate_in;
 static AVCodecContext *pCodecCtxIn;
 static AVCodecContext *pCodecCtxOut;
 static AVStream *pStreamVideoOut;
 
-AVFilterContext *buffersink_ctx;
-AVFilterContext *buffersrc_ctx;
+/*水印合成器*/
+static t_dev189_wm_compositor *compositor;
 
 static GAsyncQueue *queue_decoded_frames, *queue_filtered_frames;
 
@@ -74,6 +74,8 @@ static int open_input(const char *filename)
     iVideoStreamIndex = ret;
     av_log(NULL, AV_LOG_INFO, "Get video stream index: %d.\n", iVideoStreamIndex);
     pStreamVideoIn = pFmtCtxIn->streams[iVideoStreamIndex];
+    time_base_in = pStreamVideoIn->time_base;
+    frame_rate_in = pStreamVideoIn->r_frame_rate;
 
     //Copy the settings of AVCodecContext
     pCodecCtxIn = avcodec_alloc_context3(pCodecVideoIn);
@@ -161,65 +163,19 @@ static int open_output(const char *filename)
     return 0;
 }
 
-static int init_filters(const char *watermark)
+/*所有水印图层预先合成，每帧只混合一次*/
+static int init_filters(char *watermarks[], int count)
 {
     int ret;
-    char args[512], filters_descr[256];
-    const AVFilter *buffersrc = avfilter_get_by_name("buffer");
-    const AVFilter *buffersink = avfilter_get_by_name("buffersink");
-    AVFilterInOut *outputs = avfilter_inout_alloc();
-    AVFilterInOut *inputs = avfilter_inout_alloc();
-    enum AVPixelFormat pix_fmts[] = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE};
-    AVBufferSinkParams *buffersink_params;
-    AVRational time_base = pFmtCtxIn->streams[iVideoStreamIndex]->time_base;
-
-    AVFilterGraph *filter_graph = avfilter_graph_alloc();
-
-    /* buffer video source: the decoded frames from the decoder will be inserted here. */
-    snprintf(args, sizeof(args),
-             "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
-             pCodecCtxOut->width, pCodecCtxOut->height, pCodecCtxOut->pix_fmt,
-             time_base.num, time_base.den,
-             pCodecCtxOut->sample_aspect_ratio.num, pCodecCtxOut->sample_aspect_ratio.den);
-    ret = avfilter_graph_create_filter(&buffersrc_ctx, buffersrc, "in", args, NULL, filter_graph);
-    if (ret < 0)
-    {
-        av_log(NULL, AV_LOG_ERROR, "Cannot create buffer source\n");
-        return ret;
-    }
 
-    /* buffer video sink: to terminate the filter chain. */
-    buffersink_params = av_buffersink_params_alloc();
-    buffersink_params->pixel_fmts = pix_fmts;
-    ret = avfilter_graph_create_filter(&buffersink_ctx, buffersink, "out",
-                                       NULL, buffersink_params, filter_graph);
-    av_free(buffersink_params);
-    if (ret < 0)
+    compositor = dev189_wm_compositor_new(pCodecCtxOut->width, pCodecCtxOut->height);
+    for (int i = 0; i < count; i++)
     {
-        av_log(NULL, AV_LOG_ERROR, "Cannot create buffer sink\n");
-        return ret;
+        if ((ret = dev189_wm_compositor_add(compositor, watermarks[i])) < 0)
+            return ret;
     }
 
-    /* Endpoints for the filter graph. */
-    outputs->name = av_strdup("in");
-    outputs->filter_ctx = buffersrc_ctx;
-    outputs->pad_idx = 0;
-    outputs->next = NULL;
-
-    inputs->name = av_strdup("out");
-    inputs->filter_ctx = buffersink_ctx;
-    inputs->pad_idx = 0;
-    inputs->next = NULL;
-
-    snprintf(filters_descr, sizeof(filters_descr), "movie=%s[wm];[in][wm]overlay=1:1[out]", watermark);
-
-    if ((ret = avfilter_graph_parse_ptr(filter_graph, filters_descr, &inputs, &outputs, NULL)) < 0)
-        return ret;
-
-    if ((ret = avfilter_graph_config(filter_graph, NULL)) < 0)
-        return ret;
-
-    return 0;
+    return dev189_wm_compositor_prepare(compositor);
 }
 
 /*从输入解码放到解码队列中*/
@@ -355,15 +311,15 @@ static void *decoded_to_filter_thread_handler(void *data)
         pFrameDec = g_async_queue_try_pop(queue_decoded_frames);
         if (NULL == pFrameDec)
         {
-            dev189_monitor_timer_on(monitor, "usleep");
+            dev189_monitor_timer_on(monitor, "usleep_filter");
             g_usleep(1000);
-            dev189_monitor_timer_off(monitor, "usleep");
+            dev189_monitor_timer_off(monitor, "usleep_filter");
             continue;
         }
 
-        filter(pFrameDec);
-
-        av_frame_unref(pFrameDec);
+        /*加水印后的frame进入编码队列，由编码线程释放*/
+        if (filter(pFrameDec) < 0)
+            av_frame_free(&pFrameDec);
     }
 
     av_log(NULL, AV_LOG_INFO, "Stop decoded_to_filter_thread_handler loop.\n");
@@ -376,31 +332,19 @@ static void *decoded_to_filter_thread_handler(void *data)
 static int filter(AVFrame *pFrameDec)
 {
     int ret;
-    AVFrame *pFrameNew;
-
-    pFrameNew = av_frame_alloc();
+    AVRational time_base_ms = {1, 1000};
+    int64_t pts_ms = av_rescale_q(pFrameDec->pts, time_base_in, time_base_ms);
 
     dev189_monitor_timer_on(monitor, "filter");
-    /* push the decoded frame into the filtergraph */
-    if ((ret = av_buffersrc_add_frame_flags(buffersrc_ctx, pFrameDec, AV_BUFFERSRC_FLAG_KEEP_REF)) < 0)
+    ret = dev189_wm_compositor_apply(compositor, pFrameDec, pts_ms);
+    dev189_monitor_timer_off(monitor, "filter");
+    if (ret < 0)
     {
-        dev189_monitor_timer_off(monitor, "filter");
-        av_log(NULL, AV_LOG_ERROR, "Error while feeding the filtergraph\n");
+        av_log(NULL, AV_LOG_ERROR, "Error while adding watermark\n");
         return ret;
     }
 
-    /* pull filtered pictures from the filtergraph */
-    while (1)
-    {
-        ret = av_buffersink_get_frame(buffersink_ctx, pFrameNew);
-        dev189_monitor_timer_off(monitor, "filter");
-        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF)
-            break;
-        if (ret < 0)
-            return ret;
-
-        g_async_queue_push(queue_filtered_frames, pFrameNew);
-    }
+    g_async_queue_push(queue_filtered_frames, pFrameDec);
 
     return 0;
 }
@@ -435,15 +379,15 @@ static void *filter_to_encode_thread_handler(void *data)
         pFrameFil = g_async_queue_try_pop(queue_filtered_frames);
         if (pFrameFil == NULL)
         {
-            dev189_monitor_timer_on(monitor, "usleep");
+            dev189_monitor_timer_on(monitor, "usleep_encode");
             g_usleep(1000);
-            dev189_monitor_timer_off(monitor, "usleep");
+            dev189_monitor_timer_off(monitor, "usleep_encode");
             continue;
         }
 
         encode(pFrameFil, pPacketNew, &iFrameIndex, &iStartTime);
 
-        av_frame_unref(pFrameFil);
+        av_frame_free(&pFrameFil);
     }
 
     av_packet_unref(pPacketNew);
@@ -499,24 +443,24 @@ static int encode(AVFrame *pFrame, AVPacket *pPacket, int *iFrameIndex, int64_t
         if (pPacket->pts == AV_NOPTS_VALUE)
         {
             //Write PTS
-            AVRational time_base1 = pStreamVideoIn->time_base;
+            AVRational time_base1 = time_base_in;
             //Duration between 2 frames (us)
-            int64_t calc_duration = (double)AV_TIME_BASE / av_q2d(pStreamVideoIn->r_frame_rate);
+            int64_t calc_duration = (double)AV_TIME_BASE / av_q2d(frame_rate_in);
             //Parameters
             pPacket->pts = (double)(*iFrameIndex * calc_duration) / (double)(av_q2d(time_base1) * AV_TIME_BASE);
             pPacket->dts = pPacket->pts;
             pPacket->duration = (double)calc_duration / (double)(av_q2d(time_base1) * AV_TIME_BASE);
         }
-        AVRational time_base = pStreamVideoIn->time_base;
+        AVRational time_base = time_base_in;
         AVRational time_base_q = {1, AV_TIME_BASE};
         int64_t pts_time = av_rescale_q(pPacket->dts, time_base, time_base_q);
         int64_t now_time = av_gettime() - *iStartTime;
         if (pts_time > now_time)
             av_usleep(pts_time - now_time);
 
-        pPacket->pts = av_rescale_q_rnd(pPacket->pts, pStreamVideoIn->time_base, pStreamVideoOut->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-        pPacket->dts = av_rescale_q_rnd(pPacket->dts, pStreamVideoIn->time_base, pStreamVideoOut->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
-        pPacket->duration = av_rescale_q(pPacket->duration, pStreamVideoIn->time_base, pStreamVideoOut->time_base);
+        pPacket->pts = av_rescale_q_rnd(pPacket->pts, time_base_in, pStreamVideoOut->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+        pPacket->dts = av_rescale_q_rnd(pPacket->dts, time_base_in, pStreamVideoOut->time_base, (enum AVRounding)(AV_ROUND_NEAR_INF | AV_ROUND_PASS_MINMAX));
+        pPacket->duration = av_rescale_q(pPacket->duration, time_base_in, pStreamVideoOut->time_base);
         pPacket->pos = -1;
 
         dev189_monitor_timer_on(monitor, "write_frame");
@@ -537,20 +481,19 @@ static int encode(AVFrame *pFrame, AVPacket *pPacket, int *iFrameIndex, int64_t
 
 /**
  * shell执行
- * ./rtwm.o input.sdp rtp://127.0.0.1:5034 watermark.png
+ * ./rtwm.o input.sdp rtp://127.0.0.1:5034 watermark.png [corner.gif@280,200] [time=%H:%M:%S@8,220]
 */
 int main(int argc, char *argv[])
 {
-    const char *in_filename, *out_filename, *watermark_filename;
+    const char *in_filename, *out_filename;
 
     if (argc <= 3)
     {
-        av_log(NULL, AV_LOG_ERROR, "Usage: %s <input sdp file> <output name> <watermark name>\n", argv[0]);
+        av_log(NULL, AV_LOG_ERROR, "Usage: %s <input sdp file> <output name> <watermark>[@x,y] ...\n", argv[0]);
         exit(0);
     }
     in_filename = argv[1];
     out_filename = argv[2];
-    watermark_filename = argv[3];
 
     monitor = dev189_monitor_new();
     for (int i = 0; i < monitor_timer_LEN; i++)
@@ -572,7 +515,7 @@ int main(int argc, char *argv[])
     dev189_monitor_timer_off(monitor, "open_output");
 
     /*Watermark*/
-    if (init_filters(watermark_filename) < 0)
+    if (init_filters(argv + 3, argc - 3) < 0)
         goto end;
 
     /*接收输入并解码*/
@@ -603,6 +546,7 @@ end:
     for (int i = 0; i < monitor_timer_LEN; i++)
         av_log(NULL, AV_LOG_INFO, "\t%s\n", dev189_monitor_timer_str(monitor, timers[i]));
     dev189_monitor_free(monitor);
+    dev189_wm_compositor_free(compositor);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,740 @@
+/**
+ * 压力测试：单机能同时处理多少路加水印的视频流
+ *
+ * 一个编码线程生成VP8视频，通过N个RTP muxer在本机回环上发给N个rtwm进程，
+ * N个接收线程解码rtwm的输出，检查延时、丢帧和解码错误。从1路开始逐步增加，
+ * 直到不能满足要求为止，输出每个核能处理的路数、p99延时和每路占用的内存。
+ *
+ * 每帧底部用16个16x16的黑白方块编码帧序号，接收端通过序号找到发送时间，
+ * 因此水印不能覆盖这一区域（x=32~288，y=224~240）。
+ */
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib/gstdio.h>
+
+#include <libavformat/avformat.h>
+#include <libavutil/mathematics.h>
+#include <libavutil/time.h>
+
+#include <libavcodec/avcodec.h>
+#include <libavutil/avutil.h>
+#include <libavutil/opt.h>
+
+#include "../monitor.h"
+
+#define STRESS_WIDTH 320
+#define STRESS_HEIGHT 240
+#define STRESS_FPS 25
+#define STRESS_PAYLOAD_TYPE 100
+
+/*帧序号的位置*/
+#define STRESS_BITS 16
+#define STRESS_BIT_SIZE 16
+#define STRESS_BITS_X 32
+#define STRESS_BITS_Y (STRESS_HEIGHT - STRESS_BIT_SIZE)
+
+#define STRESS_MAX_MISS_RATIO 0.01 // 允许的迟到和丢帧比例
+#define STRESS_STOP_TIMEOUT 5      // 等待rtwm退出的时间(s)
+
+/*命令行参数*/
+static gchar *rtwm_path = "./rtwm.o";
+static gint max_streams = 64;
+static gint step = 1;
+static gint port_base = 6000;
+static gint warmup = 5;
+static gint duration = 20;
+static gint deadline_ms = 200;
+
+static GOptionEntry entries[] = {
+    {"rtwm", 'r', 0, G_OPTION_ARG_FILENAME, &rtwm_path, "rtwm executable", "PATH"},
+    {"max-streams", 'n', 0, G_OPTION_ARG_INT, &max_streams, "Stop ramping at N streams", "N"},
+    {"step", 's', 0, G_OPTION_ARG_INT, &step, "Streams added per round", "N"},
+    {"port", 'p', 0, G_OPTION_ARG_INT, &port_base, "First loopback port", "PORT"},
+    {"warmup", 'w', 0, G_OPTION_ARG_INT, &warmup, "Seconds ignored at the start of a round", "S"},
+    {"duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds measured per round", "S"},
+    {"deadline", 'l', 0, G_OPTION_ARG_INT, &deadline_ms, "End-to-end latency deadline", "MS"},
+    {NULL}};
+
+/*每一路的收发和统计*/
+typedef struct s_stress_stream
+{
+    int index;
+    char *in_sdp;  // rtwm的输入
+    char *out_sdp; // 接收rtwm的输出
+    char *in_url;
+    char *out_url;
+    int port_in;
+    int port_out;
+    AVFormatContext *pFmtCtxSend;
+    GPid pid;
+    int stdin_fd; // 关闭后rtwm退出
+    GThread *receiver;
+    /*below are stats*/
+    int received; // 解码出的所有帧，包括预热期间，用于判断rtwm是否有输出
+    int frames;
+    int late;
+    int gaps;
+    int decode_errors;
+    int last_counter;
+    GArray *latencies; // us
+} t_stress_stream;
+
+/*监控执行情况*/
+static t_dev189_monitor *monitor;
+#define monitor_timer_LEN 2
+const char *timers[monitor_timer_LEN] = {"encode", "send"};
+
+static char *work_dir;
+static char **watermarks;
+static int watermark_count;
+
+static AVCodecContext *pCodecCtxEnc;
+static GPtrArray *streams;
+static gboolean round_done;
+/*只统计这段时间内发送的帧，之前为预热，之后的帧可能还没有到达*/
+static gint64 measure_start;
+static gint64 measure_end;
+
+/*每个帧序号的发送时间*/
+static gint64 send_times[1 << STRESS_BITS];
+static GMutex send_times_lock;
+
+static void set_send_time(int counter, gint64 t)
+{
+    g_mutex_lock(&send_times_lock);
+    send_times[counter] = t;
+    g_mutex_unlock(&send_times_lock);
+}
+
+static gint64 get_send_time(int counter)
+{
+    gint64 t;
+    g_mutex_lock(&send_times_lock);
+    t = send_times[counter];
+    g_mutex_unlock(&send_times_lock);
+    return t;
+}
+
+/*移动的渐变背景，底部画出帧序号*/
+static void fill_frame(AVFrame *pFrame, int counter)
+{
+    for (int y = 0; y < STRESS_HEIGHT; y++)
+        for (int x = 0; x < STRESS_WIDTH; x++)
+            pFrame->data[0][y * pFrame->linesize[0] + x] = (x + y + counter * 4) & 0xff;
+    for (int y = 0; y < STRESS_HEIGHT / 2; y++)
+    {
+        memset(pFrame->data[1] + y * pFrame->linesize[1], 128, STRESS_WIDTH / 2);
+        memset(pFrame->data[2] + y * pFrame->linesize[2], 128, STRESS_WIDTH / 2);
+    }
+    for (int b = 0; b < STRESS_BITS; b++)
+    {
+        int value = (counter >> b) & 1 ? 235 : 16;
+        for (int y = STRESS_BITS_Y; y < STRESS_BITS_Y + STRESS_BIT_SIZE; y++)
+            memset(pFrame->data[0] + y * pFrame->linesize[0] + STRESS_BITS_X + b * STRESS_BIT_SIZE, value, STRESS_BIT_SIZE);
+    }
+}
+
+/*取每个方块中心的亮度还原帧序号*/
+static int read_counter(const AVFrame *pFrame)
+{
+    int counter = 0;
+    int y = STRESS_BITS_Y + STRESS_BIT_SIZE / 2;
+    for (int b = 0; b < STRESS_BITS; b++)
+    {
+        int x = STRESS_BITS_X + b * STRESS_BIT_SIZE + STRESS_BIT_SIZE / 2;
+        if (pFrame->data[0][y * pFrame->linesize[0] + x] > 128)
+            counter |= 1 << b;
+    }
+    return counter;
+}
+
+static int open_encoder()
+{
+    int ret;
+    AVCodec *pCodec = avcodec_find_encoder(AV_CODEC_ID_VP8);
+    if (!pCodec)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find VP8 encoder\n");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+    pCodecCtxEnc = avcodec_alloc_context3(pCodec);
+    if (pCodecCtxEnc == NULL)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Could not allocate AVCodecContext\n");
+        return AVERROR(ENOMEM);
+    }
+    pCodecCtxEnc->bit_rate = 300000;
+    pCodecCtxEnc->width = STRESS_WIDTH;
+    pCodecCtxEnc->height = STRESS_HEIGHT;
+    pCodecCtxEnc->time_base.num = 1;
+    pCodecCtxEnc->time_base.den = STRESS_FPS;
+    pCodecCtxEnc->gop_size = STRESS_FPS;
+    pCodecCtxEnc->pix_fmt = AV_PIX_FMT_YUV420P;
+    //realtime|good|best
+    av_opt_set(pCodecCtxEnc->priv_data, "deadline", "realtime", 0);
+    av_opt_set_int(pCodecCtxEnc->priv_data, "lag-in-frames", 0, 0);
+
+    if ((ret = avcodec_open2(pCodecCtxEnc, pCodec, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open VP8 encoder\n");
+        return ret;
+    }
+
+    return 0;
+}
+
+static int write_sdp(const char *filename, int port)
+{
+    GError *error = NULL;
+    gchar *sdp = g_strdup_printf("v=0\n"
+                                 "o=- 0 0 IN IP4 127.0.0.1\n"
+                                 "s=-\n"
+                                 "t=0 0\n"
+                                 "m=video %d RTP/AVP %d\n"
+                                 "c=IN IP4 127.0.0.1\n"
+                                 "a=recvonly\n"
+                                 "a=rtpmap:%d VP8/90000\n",
+                                 port, STRESS_PAYLOAD_TYPE, STRESS_PAYLOAD_TYPE);
+    g_file_set_contents(filename, sdp, -1, &error);
+    g_free(sdp);
+    if (error != NULL)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot write %s: %s\n", filename, error->message);
+        g_error_free(error);
+        return -1;
+    }
+    return 0;
+}
+
+/*RTP发送端，和rtwm的open_output相同*/
+static int open_sender(t_stress_stream *s)
+{
+    int ret;
+    AVStream *pStream;
+
+    avformat_alloc_output_context2(&s->pFmtCtxSend, NULL, "rtp", s->in_url);
+    if (!s->pFmtCtxSend)
+        return AVERROR_UNKNOWN;
+    av_opt_set_int(s->pFmtCtxSend->priv_data, "payload_type", STRESS_PAYLOAD_TYPE, 0);
+
+    if ((ret = avio_open(&s->pFmtCtxSend->pb, s->in_url, AVIO_FLAG_WRITE)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Failed to open %s\n", s->in_url);
+        goto fail;
+    }
+    if (!(pStream = avformat_new_stream(s->pFmtCtxSend, 0)))
+    {
+        ret = AVERROR_UNKNOWN;
+        goto fail;
+    }
+    if ((ret = avcodec_parameters_from_context(pStream->codecpar, pCodecCtxEnc)) < 0)
+        goto fail;
+    pStream->codecpar->codec_tag = 0;
+
+    if ((ret = avformat_write_header(s->pFmtCtxSend, NULL)) < 0)
+        goto fail;
+
+    return 0;
+
+fail:
+    avio_closep(&s->pFmtCtxSend->pb);
+    avformat_free_context(s->pFmtCtxSend);
+    s->pFmtCtxSend = NULL;
+    return ret;
+}
+
+static void close_sender(t_stress_stream *s)
+{
+    if (!s->pFmtCtxSend)
+        return;
+    av_write_trailer(s->pFmtCtxSend);
+    avio_closep(&s->pFmtCtxSend->pb);
+    avformat_free_context(s->pFmtCtxSend);
+    s->pFmtCtxSend = NULL;
+}
+
+/*启动rtwm，关闭它的标准输入相当于按回车键结束*/
+static int start_rtwm(t_stress_stream *s)
+{
+    GError *error = NULL;
+    gchar **argv = g_new0(gchar *, watermark_count + 4);
+
+    argv[0] = rtwm_path;
+    argv[1] = s->in_sdp;
+    argv[2] = s->out_url;
+    for (int i = 0; i < watermark_count; i++)
+        argv[3 + i] = watermarks[i];
+
+    g_spawn_async_with_pipes(NULL, argv, NULL,
+                             G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                             NULL, NULL, &s->pid, &s->stdin_fd, NULL, NULL, &error);
+    g_free(argv);
+    if (error != NULL)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Got error %d (%s) trying to launch %s.\n",
+               error->code, error->message ? error->message : "??", rtwm_path);
+        g_error_free(error);
+        s->pid = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void stop_rtwm(t_stress_stream *s)
+{
+    int status;
+
+    if (!s->pid)
+        return;
+    close(s->stdin_fd);
+    for (int i = 0; i < STRESS_STOP_TIMEOUT * 100; i++)
+    {
+        if (waitpid(s->pid, &status, WNOHANG) == s->pid)
+            goto end;
+        g_usleep(10000);
+    }
+    av_log(NULL, AV_LOG_WARNING, "rtwm %d does not exit, kill it.\n", s->index);
+    kill(s->pid, SIGKILL);
+    waitpid(s->pid, &status, 0);
+
+end:
+    g_spawn_close_pid(s->pid);
+    s->pid = 0;
+}
+
+/*rtwm进程占用的内存(KB)*/
+static gint64 read_rss(GPid pid)
+{
+    gint64 rss = 0;
+    gchar *status = NULL, *line;
+    gchar *filename = g_strdup_printf("/proc/%d/status", pid);
+
+    if (g_file_get_contents(filename, &status, NULL, NULL) && (line = strstr(status, "VmRSS:")))
+        rss = g_ascii_strtoll(line + strlen("VmRSS:"), NULL, 10);
+    g_free(status);
+    g_free(filename);
+
+    return rss;
+}
+
+/*编码一次，发给所有rtwm*/
+static void *generator_thread_handler(void *data)
+{
+    int ret;
+    AVFrame *pFrame = av_frame_alloc();
+    AVPacket *pPacket = av_packet_alloc();
+    gint64 start = av_gettime_relative();
+
+    pFrame->format = AV_PIX_FMT_YUV420P;
+    pFrame->width = STRESS_WIDTH;
+    pFrame->height = STRESS_HEIGHT;
+    av_frame_get_buffer(pFrame, 32);
+
+    for (int64_t i = 0; !round_done; i++)
+    {
+        int counter = i & ((1 << STRESS_BITS) - 1);
+        gint64 next = start + i * G_USEC_PER_SEC / STRESS_FPS;
+        gint64 now = av_gettime_relative();
+        if (next > now)
+            av_usleep(next - now);
+
+        av_frame_make_writable(pFrame);
+        fill_frame(pFrame, counter);
+        pFrame->pts = i;
+
+        set_send_time(counter, av_gettime_relative());
+
+        dev189_monitor_timer_on(monitor, "encode");
+        ret = avcodec_send_frame(pCodecCtxEnc, pFrame);
+        dev189_monitor_timer_off(monitor, "encode");
+        if (ret < 0)
+        {
+            av_log(NULL, AV_LOG_ERROR, "Error sending a frame for encoding\n");
+            break;
+        }
+
+        while (avcodec_receive_packet(pCodecCtxEnc, pPacket) >= 0)
+        {
+            dev189_monitor_timer_on(monitor, "send");
+            for (guint j = 0; j < streams->len; j++)
+            {
+                t_stress_stream *s = g_ptr_array_index(streams, j);
+                AVPacket *pPacketOut = av_packet_clone(pPacket);
+                av_packet_rescale_ts(pPacketOut, pCodecCtxEnc->time_base, s->pFmtCtxSend->streams[0]->time_base);
+                av_write_frame(s->pFmtCtxSend, pPacketOut);
+                av_packet_free(&pPacketOut);
+            }
+            dev189_monitor_timer_off(monitor, "send");
+            av_packet_unref(pPacket);
+        }
+    }
+
+    av_packet_free(&pPacket);
+    av_frame_free(&pFrame);
+
+    return NULL;
+}
+
+static int interrupt_cb(void *data)
+{
+    return round_done;
+}
+
+/*检查一帧的延时和序号*/
+static void check_frame(t_stress_stream *s, const AVFrame *pFrame, gint64 now)
+{
+    int gap, counter = read_counter(pFrame);
+    gint64 sent = get_send_time(counter);
+    gint64 latency = now - sent;
+
+    if (!sent || sent < measure_start || sent > measure_end)
+    {
+        s->last_counter = counter;
+        return;
+    }
+    /*序号被破坏时找不到合理的发送时间*/
+    if ((pFrame->flags & AV_FRAME_FLAG_CORRUPT) || pFrame->decode_error_flags ||
+        latency < 0 || latency > 10 * G_USEC_PER_SEC)
+    {
+        s->decode_errors++;
+        return;
+    }
+
+    s->frames++;
+    g_array_append_val(s->latencies, latency);
+    if (latency > deadline_ms * 1000)
+        s->late++;
+    if (s->last_counter >= 0)
+    {
+        gap = (counter - s->last_counter - 1) & ((1 << STRESS_BITS) - 1);
+        if (gap > 0 && gap < (1 << (STRESS_BITS - 1)))
+            s->gaps++;
+    }
+    s->last_counter = counter;
+}
+
+/*接收并解码rtwm的输出*/
+static void *receiver_thread_handler(void *data)
+{
+    t_stress_stream *s = data;
+    int ret;
+    AVPacket packet;
+    AVCodec *pCodec;
+    AVCodecContext *pCodecCtx = NULL;
+    AVFrame *pFrame = av_frame_alloc();
+    AVFormatContext *pFmtCtx = avformat_alloc_context();
+
+    pFmtCtx->iformat = av_find_input_format("sdp");
+    pFmtCtx->interrupt_callback.callback = interrupt_cb;
+    av_opt_set(pFmtCtx, "protocol_whitelist", "file,udp,rtp", 0);
+    av_opt_set_int(pFmtCtx, "max_delay", 100000, 0);
+
+    if (avformat_open_input(&pFmtCtx, s->out_sdp, 0, 0) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Could not open %s.\n", s->out_sdp);
+        goto end;
+    }
+    /*SDP中已经有编码格式，不用avformat_find_stream_info等待数据*/
+    pCodec = avcodec_find_decoder(pFmtCtx->streams[0]->codecpar->codec_id);
+    pCodecCtx = avcodec_alloc_context3(pCodec);
+    avcodec_parameters_to_context(pCodecCtx, pFmtCtx->streams[0]->codecpar);
+    if (avcodec_open2(pCodecCtx, pCodec, NULL) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot open video decoder\n");
+        goto end;
+    }
+
+    while (!round_done)
+    {
+        if ((ret = av_read_frame(pFmtCtx, &packet)) < 0)
+        {
+            if (AVERROR(ETIMEDOUT) == ret || AVERROR(EAGAIN) == ret)
+                continue;
+            break;
+        }
+        /*预热期间等待关键帧产生的错误不计*/
+        if (avcodec_send_packet(pCodecCtx, &packet) < 0 && av_gettime_relative() >= measure_start)
+            s->decode_errors++;
+        av_packet_unref(&packet);
+
+        while (avcodec_receive_frame(pCodecCtx, pFrame) >= 0)
+        {
+            g_atomic_int_inc(&s->received);
+            check_frame(s, pFrame, av_gettime_relative());
+            av_frame_unref(pFrame);
+        }
+    }
+
+end:
+    av_frame_free(&pFrame);
+    avcodec_free_context(&pCodecCtx);
+    avformat_close_input(&pFmtCtx);
+
+    return NULL;
+}
+
+static t_stress_stream *stream_new(int index)
+{
+    t_stress_stream *s = g_malloc0(sizeof(t_stress_stream));
+
+    s->index = index;
+    s->in_sdp = g_strdup_printf("%s/in-%d.sdp", work_dir, index);
+    s->out_sdp = g_strdup_printf("%s/out-%d.sdp", work_dir, index);
+    s->port_in = port_base + index * 4;
+    s->port_out = port_base + max_streams * 4 + index * 4;
+    s->in_url = g_strdup_printf("rtp://127.0.0.1:%d", s->port_in);
+    s->out_url = g_strdup_printf("rtp://127.0.0.1:%d", s->port_out);
+    s->last_counter = -1;
+    s->latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+    return s;
+}
+
+static void stream_free(gpointer data)
+{
+    t_stress_stream *s = data;
+
+    close_sender(s);
+    g_remove(s->in_sdp);
+    g_remove(s->out_sdp);
+    g_free(s->in_sdp);
+    g_free(s->out_sdp);
+    g_free(s->in_url);
+    g_free(s->out_url);
+    g_array_free(s->latencies, TRUE);
+    g_free(s);
+}
+
+/*rtwm是否已经退出，退出时回收进程*/
+static gboolean rtwm_exited(t_stress_stream *s)
+{
+    int status;
+
+    if (!s->pid || waitpid(s->pid, &status, WNOHANG) != s->pid)
+        return FALSE;
+    close(s->stdin_fd);
+    g_spawn_close_pid(s->pid);
+    s->pid = 0;
+    return TRUE;
+}
+
+/*环境有问题时不是达到了容量，停止已经启动的部分*/
+static void abort_round(GThread *generator)
+{
+    for (guint i = 0; i < streams->len; i++)
+        stop_rtwm(g_ptr_array_index(streams, i));
+    round_done = TRUE;
+    if (generator)
+        g_thread_join(generator);
+    for (guint i = 0; i < streams->len; i++)
+    {
+        t_stress_stream *s = g_ptr_array_index(streams, i);
+        if (s->receiver)
+            g_thread_join(s->receiver);
+    }
+    g_ptr_array_free(streams, TRUE);
+    streams = NULL;
+}
+
+static int compare_latency(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * 运行一轮，n路同时处理；满足要求时返回1，不满足返回0，无法启动时返回负数。
+ * 第一轮只有1路，预热后还没有输出说明rtwm启动失败（如水印文件错误），而不是达到了容量。
+ */
+static int run_round(int n, gboolean first, double *p99_ms, double *rss_mb)
+{
+    GThread *generator = NULL;
+    GArray *latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+    int frames = 0, late = 0, gaps = 0, decode_errors = 0, missing = 0, expected = 0;
+    gint64 rss_kb = 0;
+    double p50_ms = 0;
+    gboolean pass, started = TRUE;
+
+    round_done = FALSE;
+    measure_start = av_gettime_relative() + warmup * G_USEC_PER_SEC;
+    measure_end = G_MAXINT64;
+    memset(send_times, 0, sizeof(send_times));
+    streams = g_ptr_array_new_with_free_func(stream_free);
+
+    for (int i = 0; i < n; i++)
+    {
+        t_stress_stream *s = stream_new(i);
+        g_ptr_array_add(streams, s);
+        if (write_sdp(s->in_sdp, s->port_in) < 0 || write_sdp(s->out_sdp, s->port_out) < 0 ||
+            open_sender(s) < 0 || start_rtwm(s) < 0 ||
+            !(s->receiver = g_thread_try_new("receiver", receiver_thread_handler, s, NULL)))
+        {
+            av_log(NULL, AV_LOG_ERROR, "Cannot start stream %d.\n", i);
+            started = FALSE;
+            break;
+        }
+    }
+    if (started && !(generator = g_thread_try_new("generator", generator_thread_handler, NULL, NULL)))
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot start generator thread.\n");
+        started = FALSE;
+    }
+
+    /*预热结束时每个rtwm都应该在运行，第一轮时还应该有输出*/
+    if (started)
+    {
+        g_usleep(warmup * G_USEC_PER_SEC);
+        for (guint i = 0; i < streams->len && started; i++)
+        {
+            t_stress_stream *s = g_ptr_array_index(streams, i);
+            if (rtwm_exited(s))
+            {
+                av_log(NULL, AV_LOG_ERROR, "rtwm %d exited during warmup.\n", s->index);
+                started = FALSE;
+            }
+            else if (first && g_atomic_int_get(&s->received) == 0)
+            {
+                av_log(NULL, AV_LOG_ERROR, "rtwm %d has no output after %d(s) warmup, check the watermarks and --rtwm.\n",
+                       s->index, warmup);
+                started = FALSE;
+            }
+        }
+    }
+
+    if (!started)
+    {
+        abort_round(generator);
+        g_array_free(latencies, TRUE);
+        return -1;
+    }
+
+    g_usleep(duration * G_USEC_PER_SEC);
+
+    for (guint i = 0; i < streams->len; i++)
+    {
+        t_stress_stream *s = g_ptr_array_index(streams, i);
+        if (s->pid)
+            rss_kb += read_rss(s->pid);
+    }
+    /*最后发送的帧还在路上，等它们超过deadline再结束统计*/
+    measure_end = av_gettime_relative();
+    g_usleep(deadline_ms * 1000);
+
+    /*先停rtwm，发送端继续发送，rtwm的解码线程才能退出循环*/
+    for (guint i = 0; i < streams->len; i++)
+        stop_rtwm(g_ptr_array_index(streams, i));
+    round_done = TRUE;
+    if (generator)
+        g_thread_join(generator);
+
+    for (int i = 0; i < (1 << STRESS_BITS); i++)
+        if (send_times[i] >= measure_start && send_times[i] <= measure_end)
+            expected++;
+
+    for (guint i = 0; i < streams->len; i++)
+    {
+        t_stress_stream *s = g_ptr_array_index(streams, i);
+        if (s->receiver)
+            g_thread_join(s->receiver);
+        frames += s->frames;
+        late += s->late;
+        gaps += s->gaps;
+        decode_errors += s->decode_errors;
+        missing += MAX(expected - s->frames, 0);
+        g_array_append_vals(latencies, s->latencies->data, s->latencies->len);
+    }
+    g_ptr_array_free(streams, TRUE);
+    streams = NULL;
+
+    *p99_ms = 0;
+    if (latencies->len)
+    {
+        g_array_sort(latencies, compare_latency);
+        p50_ms = g_array_index(latencies, gint64, (latencies->len - 1) / 2) / 1000.0;
+        *p99_ms = g_array_index(latencies, gint64, (latencies->len - 1) * 99 / 100) / 1000.0;
+    }
+    g_array_free(latencies, TRUE);
+    *rss_mb = rss_kb / 1024.0 / n;
+
+    pass = frames > 0 && decode_errors == 0 &&
+           late + missing <= STRESS_MAX_MISS_RATIO * expected * n;
+    av_log(NULL, AV_LOG_INFO,
+           "streams=%d frames=%d/%d late=%d gaps=%d missing=%d decode_errors=%d p50=%.1f(ms) p99=%.1f(ms) rss/stream=%.1f(MB) %s\n",
+           n, frames, expected * n, late, gaps, missing, decode_errors, p50_ms, *p99_ms, *rss_mb,
+           pass ? "PASS" : "FAIL");
+
+    return pass;
+}
+
+/**
+ * shell执行
+ * ./stress.o --rtwm ./rtwm.o --max-streams 32 watermark.png
+*/
+int main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new("<watermark>[@x,y] ... - rtwm channel density stress test");
+    int cores = g_get_num_processors();
+    int ret = 0, capacity = 0;
+    double p99_ms, rss_mb, capacity_p99_ms = 0, capacity_rss_mb = 0;
+
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error) || argc < 2 || step < 1 || max_streams < 1)
+    {
+        av_log(NULL, AV_LOG_ERROR, "%s\n", error ? error->message : g_option_context_get_help(context, TRUE, NULL));
+        exit(0);
+    }
+    g_option_context_free(context);
+    watermarks = argv + 1;
+    watermark_count = argc - 1;
+
+    monitor = dev189_monitor_new();
+    for (int i = 0; i < monitor_timer_LEN; i++)
+        dev189_monitor_timer_new(monitor, timers[i]);
+
+    avformat_network_init();
+    if (!(work_dir = g_dir_make_tmp("rtwm-stress-XXXXXX", &error)))
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot create work dir: %s\n", error->message);
+        exit(0);
+    }
+
+    for (int n = 1; n <= max_streams; n += step)
+    {
+        /*每轮重新打开编码器，第一帧是关键帧*/
+        if ((ret = open_encoder()) < 0)
+            break;
+        ret = run_round(n, n == 1, &p99_ms, &rss_mb);
+        avcodec_free_context(&pCodecCtxEnc);
+        if (ret <= 0)
+            break;
+        capacity = n;
+        capacity_p99_ms = p99_ms;
+        capacity_rss_mb = rss_mb;
+    }
+    g_rmdir(work_dir);
+
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Stress test aborted, no capacity measured.\n");
+        dev189_monitor_free(monitor);
+        return 1;
+    }
+
+    av_log(NULL, AV_LOG_INFO, "-----Capacity-----\n");
+    av_log(NULL, AV_LOG_INFO, "\tstreams=%d cores=%d streams/core=%.2f p99=%.1f(ms) rss/stream=%.1f(MB)\n",
+           capacity, cores, (double)capacity / cores, capacity_p99_ms, capacity_rss_mb);
+
+    //Output monitor
+    av_log(NULL, AV_LOG_INFO, "-----Monitor Info-----\n");
+    for (int i = 0; i < monitor_timer_LEN; i++)
+        av_log(NULL, AV_LOG_INFO, "\t%s\n", dev189_monitor_timer_str(monitor, timers[i]));
+    dev189_monitor_free(monitor);
+
+    return 0;
+}
@@ -0,0 +1,662 @@
+/**
+ * 水印合成器
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/opt.h>
+#include <libswscale/swscale.h>
+
+#include "wmcomp.h"
+
+#define WM_FONT_SIZE 16
+#define WM_TEXT_LEN 128
+#define WM_FRAME_DURATION 100 // 动画帧没有时长时的默认值(ms)
+
+/*清空为透明，预乘后透明像素的值为Y=0,U=V=128,A=0*/
+static void wm_frame_clear(AVFrame *frame)
+{
+    for (int y = 0; y < frame->height; y++)
+    {
+        memset(frame->data[0] + y * frame->linesize[0], 0, frame->width);
+        memset(frame->data[3] + y * frame->linesize[3], 0, frame->width);
+    }
+    for (int y = 0; y < frame->height / 2; y++)
+    {
+        memset(frame->data[1] + y * frame->linesize[1], 128, frame->width / 2);
+        memset(frame->data[2] + y * frame->linesize[2], 128, frame->width / 2);
+    }
+}
+
+/*分配透明的YUVA420P帧，宽高对齐为偶数，保证每个色度像素都有完整的2x2 alpha*/
+static AVFrame *wm_frame_alloc(int width, int height)
+{
+    AVFrame *frame = av_frame_alloc();
+    if (!frame)
+        return NULL;
+    frame->format = AV_PIX_FMT_YUVA420P;
+    frame->width = FFALIGN(width, 2);
+    frame->height = FFALIGN(height, 2);
+    if (av_frame_get_buffer(frame, 32) < 0)
+    {
+        av_frame_free(&frame);
+        return NULL;
+    }
+    wm_frame_clear(frame);
+    return frame;
+}
+
+static void wm_frame_destroy(gpointer frame)
+{
+    AVFrame *f = frame;
+    av_frame_free(&f);
+}
+
+/*色度像素对应的alpha取2x2亮度像素的平均值*/
+static inline int wm_chroma_alpha(const AVFrame *frame, int cx, int cy)
+{
+    const uint8_t *a0 = frame->data[3] + 2 * cy * frame->linesize[3] + 2 * cx;
+    const uint8_t *a1 = a0 + frame->linesize[3];
+    return (a0[0] + a0[1] + a1[0] + a1[1] + 2) >> 2;
+}
+
+/*任意格式转换为预乘alpha的YUVA420P，sws在多次转换之间复用，由调用者释放*/
+static AVFrame *wm_frame_premultiplied(const AVFrame *src, struct SwsContext **sws)
+{
+    AVFrame *dst;
+
+    if (!(dst = wm_frame_alloc(src->width, src->height)))
+        return NULL;
+    *sws = sws_getCachedContext(*sws, src->width, src->height, src->format,
+                                src->width, src->height, AV_PIX_FMT_YUVA420P,
+                                SWS_BICUBIC, NULL, NULL, NULL);
+    if (!*sws)
+    {
+        av_frame_free(&dst);
+        return NULL;
+    }
+    sws_scale(*sws, (const uint8_t *const *)src->data, src->linesize, 0, src->height, dst->data, dst->linesize);
+
+    for (int y = 0; y < dst->height; y++)
+    {
+        uint8_t *py = dst->data[0] + y * dst->linesize[0];
+        const uint8_t *pa = dst->data[3] + y * dst->linesize[3];
+        for (int x = 0; x < dst->width; x++)
+            py[x] = (py[x] * pa[x] + 127) / 255;
+    }
+    for (int y = 0; y < dst->height / 2; y++)
+    {
+        uint8_t *pu = dst->data[1] + y * dst->linesize[1];
+        uint8_t *pv = dst->data[2] + y * dst->linesize[2];
+        for (int x = 0; x < dst->width / 2; x++)
+        {
+            int a = wm_chroma_alpha(dst, x, y);
+            pu[x] = 128 + (pu[x] - 128) * a / 255;
+            pv[x] = 128 + (pv[x] - 128) * a / 255;
+        }
+    }
+
+    return dst;
+}
+
+/*裁掉四周的透明区域，减小缓存和需要混合的面积，offset返回裁剪后帧的位置*/
+static AVFrame *wm_frame_crop(AVFrame *frame, t_dev189_wm_point *offset)
+{
+    AVFrame *cropped;
+    int x0 = frame->width, y0 = frame->height, x1 = 0, y1 = 0;
+
+    offset->x = 0;
+    offset->y = 0;
+    for (int y = 0; y < frame->height; y++)
+    {
+        const uint8_t *pa = frame->data[3] + y * frame->linesize[3];
+        for (int x = 0; x < frame->width; x++)
+        {
+            if (pa[x])
+            {
+                x0 = FFMIN(x0, x);
+                x1 = FFMAX(x1, x + 1);
+                y0 = FFMIN(y0, y);
+                y1 = y + 1;
+            }
+        }
+    }
+    /*全透明时保留最小的2x2*/
+    if (x1 <= x0 || y1 <= y0)
+        x0 = y0 = 0, x1 = y1 = 2;
+    /*保持4:2:0对齐*/
+    x0 &= ~1;
+    y0 &= ~1;
+    x1 = FFMIN(FFALIGN(x1, 2), frame->width);
+    y1 = FFMIN(FFALIGN(y1, 2), frame->height);
+    if (x0 == 0 && y0 == 0 && x1 == frame->width && y1 == frame->height)
+        return frame;
+    if (!(cropped = wm_frame_alloc(x1 - x0, y1 - y0)))
+        return frame;
+
+    for (int y = 0; y < cropped->height; y++)
+    {
+        memcpy(cropped->data[0] + y * cropped->linesize[0], frame->data[0] + (y0 + y) * frame->linesize[0] + x0, cropped->width);
+        memcpy(cropped->data[3] + y * cropped->linesize[3], frame->data[3] + (y0 + y) * frame->linesize[3] + x0, cropped->width);
+    }
+    for (int y = 0; y < cropped->height / 2; y++)
+    {
+        memcpy(cropped->data[1] + y * cropped->linesize[1], frame->data[1] + (y0 / 2 + y) * frame->linesize[1] + x0 / 2, cropped->width / 2);
+        memcpy(cropped->data[2] + y * cropped->linesize[2], frame->data[2] + (y0 / 2 + y) * frame->linesize[2] + x0 / 2, cropped->width / 2);
+    }
+    av_frame_free(&frame);
+    offset->x = x0;
+    offset->y = y0;
+
+    return cropped;
+}
+
+/**
+ * 把预乘的src叠加到dst的(dx,dy)处，dx、dy为非负偶数，超出dst的部分被裁掉。
+ * dst为YUVA420P时同时更新alpha，用于合成图层；为YUV420P时直接混合到视频帧。
+ */
+static void wm_blend(AVFrame *dst, int dx, int dy, const AVFrame *src)
+{
+    int w = FFMIN(src->width, dst->width - dx);
+    int h = FFMIN(src->height, dst->height - dy);
+    int has_alpha = dst->format == AV_PIX_FMT_YUVA420P;
+
+    if (w <= 0 || h <= 0)
+        return;
+
+    for (int y = 0; y < h; y++)
+    {
+        const uint8_t *sy = src->data[0] + y * src->linesize[0];
+        const uint8_t *sa = src->data[3] + y * src->linesize[3];
+        uint8_t *py = dst->data[0] + (dy + y) * dst->linesize[0] + dx;
+        uint8_t *pa = has_alpha ? dst->data[3] + (dy + y) * dst->linesize[3] + dx : NULL;
+        for (int x = 0; x < w; x++)
+        {
+            int ia = 255 - sa[x];
+            if (ia == 255)
+                continue;
+            py[x] = sy[x] + (py[x] * ia + 127) / 255;
+            if (pa)
+                pa[x] = sa[x] + (pa[x] * ia + 127) / 255;
+        }
+    }
+
+    for (int y = 0; y < (h + 1) / 2; y++)
+    {
+        const uint8_t *su = src->data[1] + y * src->linesize[1];
+        const uint8_t *sv = src->data[2] + y * src->linesize[2];
+        uint8_t *pu = dst->data[1] + (dy / 2 + y) * dst->linesize[1] + dx / 2;
+        uint8_t *pv = dst->data[2] + (dy / 2 + y) * dst->linesize[2] + dx / 2;
+        for (int x = 0; x < (w + 1) / 2; x++)
+        {
+            int ia = 255 - wm_chroma_alpha(src, x, y);
+            if (ia == 255)
+                continue;
+            pu[x] = av_clip_uint8(su[x] + (pu[x] - 128) * ia / 255);
+            pv[x] = av_clip_uint8(sv[x] + (pv[x] - 128) * ia / 255);
+        }
+    }
+}
+
+/*解码图片文件的所有帧，单帧为静态图片，多帧为循环播放的动画*/
+static int wm_layer_load(t_dev189_wm_layer *layer)
+{
+    int ret, index, eof = 0;
+    int64_t start = 0;
+    AVFormatContext *pFmtCtx = NULL;
+    AVCodecContext *pCodecCtx = NULL;
+    AVCodec *pCodec;
+    AVPacket packet;
+    AVRational time_base;
+    AVRational time_base_ms = {1, 1000};
+    AVFrame *pFrame = av_frame_alloc();
+    struct SwsContext *sws = NULL;
+
+    if ((ret = avformat_open_input(&pFmtCtx, layer->source, NULL, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Could not open watermark %s.\n", layer->source);
+        goto end;
+    }
+    if ((ret = avformat_find_stream_info(pFmtCtx, NULL)) < 0)
+        goto end;
+    if ((ret = av_find_best_stream(pFmtCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &pCodec, 0)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot find an image in watermark %s.\n", layer->source);
+        goto end;
+    }
+    index = ret;
+    time_base = pFmtCtx->streams[index]->time_base;
+
+    if (!(pCodecCtx = avcodec_alloc_context3(pCodec)))
+    {
+        ret = AVERROR(ENOMEM);
+        goto end;
+    }
+    avcodec_parameters_to_context(pCodecCtx, pFmtCtx->streams[index]->codecpar);
+    if ((ret = avcodec_open2(pCodecCtx, pCodec, NULL)) < 0)
+        goto end;
+
+    while (!eof)
+    {
+        if (av_read_frame(pFmtCtx, &packet) < 0)
+        {
+            eof = 1;
+            avcodec_send_packet(pCodecCtx, NULL);
+        }
+        else
+        {
+            if (packet.stream_index == index)
+                avcodec_send_packet(pCodecCtx, &packet);
+            av_packet_unref(&packet);
+        }
+
+        while (avcodec_receive_frame(pCodecCtx, pFrame) >= 0)
+        {
+            /*GIF/APNG解码出的每帧都是整个画布，只缓存不透明的部分*/
+            AVFrame *pFrameWm = wm_frame_premultiplied(pFrame, &sws);
+            int64_t duration = av_rescale_q(pFrame->pkt_duration, time_base, time_base_ms);
+            t_dev189_wm_point offset;
+
+            av_frame_unref(pFrame);
+            if (!pFrameWm)
+            {
+                ret = AVERROR(ENOMEM);
+                goto end;
+            }
+            pFrameWm = wm_frame_crop(pFrameWm, &offset);
+            g_ptr_array_add(layer->frames, pFrameWm);
+            g_array_append_val(layer->offsets, offset);
+            g_array_append_val(layer->starts, start);
+            start += duration > 0 ? duration : WM_FRAME_DURATION;
+        }
+    }
+
+    if (layer->frames->len == 0)
+    {
+        ret = AVERROR_INVALIDDATA;
+        goto end;
+    }
+    layer->type = layer->frames->len > 1 ? DEV189_WM_LAYER_ANIMATED : DEV189_WM_LAYER_IMAGE;
+    layer->loop_duration = start;
+    layer->current = 0;
+    layer->frame = g_ptr_array_index(layer->frames, 0);
+    layer->offset = g_array_index(layer->offsets, t_dev189_wm_point, 0);
+    av_log(NULL, AV_LOG_INFO, "Watermark %s: %dx%d, %u frames, loop %" PRId64 "ms.\n",
+           layer->source, layer->frame->width, layer->frame->height, layer->frames->len, layer->loop_duration);
+    ret = 0;
+
+end:
+    sws_freeContext(sws);
+    av_frame_free(&pFrame);
+    avcodec_free_context(&pCodecCtx);
+    avformat_close_input(&pFmtCtx);
+    return ret;
+}
+
+/**
+ * 创建文字图层的drawtext滤镜，文字变化时复用。
+ * 初始化时要加载字体，放在添加图层时做，不占用实时的filter线程。
+ */
+static int wm_text_open(t_dev189_wm_compositor *comp, t_dev189_wm_layer *layer, const char *text)
+{
+    int ret;
+    char args[128];
+
+    if (!(layer->text_graph = avfilter_graph_alloc()))
+        return AVERROR(ENOMEM);
+
+    snprintf(args, sizeof(args),
+             "video_size=%dx%d:pix_fmt=%d:time_base=1/1:pixel_aspect=1/1",
+             comp->width - layer->x, WM_FONT_SIZE * 2, AV_PIX_FMT_RGBA);
+    if ((ret = avfilter_graph_create_filter(&layer->text_src, avfilter_get_by_name("buffer"), "in", args, NULL, layer->text_graph)) < 0)
+        return ret;
+
+    /*用av_opt_set设置参数，文字中的特殊字符不需要转义*/
+    layer->text_draw = avfilter_graph_alloc_filter(layer->text_graph, avfilter_get_by_name("drawtext"), "text");
+    if (!layer->text_draw)
+        return AVERROR(ENOMEM);
+    av_opt_set(layer->text_draw, "text", text, AV_OPT_SEARCH_CHILDREN);
+    av_opt_set(layer->text_draw, "expansion", "none", AV_OPT_SEARCH_CHILDREN);
+    av_opt_set(layer->text_draw, "fontcolor", "white", AV_OPT_SEARCH_CHILDREN);
+    av_opt_set(layer->text_draw, "bordercolor", "black", AV_OPT_SEARCH_CHILDREN);
+    av_opt_set_int(layer->text_draw, "borderw", 1, AV_OPT_SEARCH_CHILDREN);
+    av_opt_set_int(layer->text_draw, "fontsize", WM_FONT_SIZE, AV_OPT_SEARCH_CHILDREN);
+    if ((ret = avfilter_init_str(layer->text_draw, NULL)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot init drawtext filter\n");
+        return ret;
+    }
+
+    if ((ret = avfilter_graph_create_filter(&layer->text_sink, avfilter_get_by_name("buffersink"), "out", NULL, NULL, layer->text_graph)) < 0)
+        return ret;
+    if ((ret = avfilter_link(layer->text_src, 0, layer->text_draw, 0)) < 0 ||
+        (ret = avfilter_link(layer->text_draw, 0, layer->text_sink, 0)) < 0)
+        return ret;
+
+    return avfilter_graph_config(layer->text_graph, NULL);
+}
+
+/*更新drawtext的文字，把透明的RGBA画布送入滤镜*/
+static AVFrame *wm_text_render(t_dev189_wm_layer *layer, const char *text, t_dev189_wm_point *offset)
+{
+    AVFrame *pFrame = av_frame_alloc();
+    AVFrame *pFrameWm = NULL;
+    AVFilterLink *link = layer->text_src->outputs[0];
+
+    if (!pFrame)
+        return NULL;
+    /*expansion=none时drawtext每帧直接使用text参数*/
+    if (av_opt_set(layer->text_draw, "text", text, AV_OPT_SEARCH_CHILDREN) < 0)
+        goto end;
+
+    pFrame->format = AV_PIX_FMT_RGBA;
+    pFrame->width = link->w;
+    pFrame->height = link->h;
+    pFrame->pts = layer->text_pts++;
+    if (av_frame_get_buffer(pFrame, 32) < 0)
+        goto end;
+    for (int y = 0; y < pFrame->height; y++)
+        memset(pFrame->data[0] + y * pFrame->linesize[0], 0, pFrame->width * 4);
+
+    if (av_buffersrc_add_frame(layer->text_src, pFrame) < 0)
+        goto end;
+    if (av_buffersink_get_frame(layer->text_sink, pFrame) < 0)
+        goto end;
+
+    if ((pFrameWm = wm_frame_premultiplied(pFrame, &layer->text_sws)))
+        pFrameWm = wm_frame_crop(pFrameWm, offset);
+
+end:
+    av_frame_free(&pFrame);
+    return pFrameWm;
+}
+
+/*文字变化时重新渲染*/
+static int wm_layer_set_text(t_dev189_wm_compositor *comp, t_dev189_wm_layer *layer, const char *text)
+{
+    int ret;
+    AVFrame *pFrameWm;
+    t_dev189_wm_point offset;
+
+    if (layer->text && strcmp(layer->text, text) == 0)
+        return 0;
+
+    if (!layer->text_graph && (ret = wm_text_open(comp, layer, text)) < 0)
+    {
+        avfilter_graph_free(&layer->text_graph);
+        return ret;
+    }
+    pFrameWm = wm_text_render(layer, text, &offset);
+    if (!pFrameWm)
+        return AVERROR(EINVAL);
+
+    g_ptr_array_set_size(layer->frames, 0);
+    g_ptr_array_add(layer->frames, pFrameWm);
+    layer->frame = pFrameWm;
+    layer->offset = offset;
+    g_free(layer->text);
+    layer->text = g_strdup(text);
+    comp->dirty = TRUE;
+
+    return 0;
+}
+
+static int wm_layer_update_clock(t_dev189_wm_compositor *comp, t_dev189_wm_layer *layer)
+{
+    char text[WM_TEXT_LEN];
+    time_t now = time(NULL);
+    struct tm tm_now;
+
+    localtime_r(&now, &tm_now);
+    if (strftime(text, sizeof(text), layer->source, &tm_now) == 0)
+        return AVERROR(EINVAL);
+
+    return wm_layer_set_text(comp, layer, text);
+}
+
+/*根据时间戳选择动画帧*/
+static void wm_layer_update_animated(t_dev189_wm_compositor *comp, t_dev189_wm_layer *layer, int64_t pts_ms)
+{
+    int64_t t = pts_ms % layer->loop_duration;
+    guint i = 0;
+
+    if (t < 0)
+        t += layer->loop_duration;
+    while (i + 1 < layer->starts->len && g_array_index(layer->starts, int64_t, i + 1) <= t)
+        i++;
+
+    if (i != layer->current)
+    {
+        layer->current = i;
+        layer->frame = g_ptr_array_index(layer->frames, i);
+        layer->offset = g_array_index(layer->offsets, t_dev189_wm_point, i);
+        comp->dirty = TRUE;
+    }
+}
+
+static void wm_layer_free(gpointer data)
+{
+    t_dev189_wm_layer *layer = data;
+
+    g_ptr_array_free(layer->frames, TRUE);
+    g_array_free(layer->starts, TRUE);
+    g_array_free(layer->offsets, TRUE);
+    avfilter_graph_free(&layer->text_graph);
+    sws_freeContext(layer->text_sws);
+    g_free(layer->source);
+    g_free(layer->text);
+    g_free(layer);
+}
+
+/*扩展矩形，使其包含(x,y)处的frame，超出视频的部分被裁掉*/
+static void wm_rect_extend(t_dev189_wm_compositor *comp, int rect[4], int x, int y, const AVFrame *frame)
+{
+    if (!frame)
+        return;
+    rect[0] = FFMIN(rect[0], x);
+    rect[1] = FFMIN(rect[1], y);
+    rect[2] = FFMAX(rect[2], FFMIN(x + frame->width, comp->width));
+    rect[3] = FFMAX(rect[3], FFMIN(y + frame->height, comp->height));
+}
+
+t_dev189_wm_compositor *dev189_wm_compositor_new(int width, int height)
+{
+    t_dev189_wm_compositor *comp = g_malloc0(sizeof(t_dev189_wm_compositor));
+    comp->width = width;
+    comp->height = height;
+    comp->layers = g_ptr_array_new_with_free_func(wm_layer_free);
+    return comp;
+}
+
+void dev189_wm_compositor_free(t_dev189_wm_compositor *comp)
+{
+    if (!comp)
+        return;
+    g_ptr_array_free(comp->layers, TRUE);
+    av_frame_free(&comp->flat);
+    av_frame_free(&comp->canvas);
+    g_free(comp);
+}
+
+int dev189_wm_compositor_add(t_dev189_wm_compositor *comp, const char *spec)
+{
+    int ret = 0, x = 0, y = 0;
+    const char *at = strrchr(spec, '@');
+    t_dev189_wm_layer *layer = g_malloc0(sizeof(t_dev189_wm_layer));
+
+    layer->frames = g_ptr_array_new_with_free_func(wm_frame_destroy);
+    layer->starts = g_array_new(FALSE, FALSE, sizeof(int64_t));
+    layer->offsets = g_array_new(FALSE, FALSE, sizeof(t_dev189_wm_point));
+
+    /*没有合法的坐标时把@当作文字或文件名的一部分*/
+    if (at && sscanf(at + 1, "%d,%d", &x, &y) == 2)
+        layer->source = g_strndup(spec, at - spec);
+    else
+        layer->source = g_strdup(spec);
+
+    /*4:2:0的色度按2x2采样，坐标向下对齐为偶数*/
+    layer->x = FFMAX(x, 0) & ~1;
+    layer->y = FFMAX(y, 0) & ~1;
+    if (layer->x >= comp->width || layer->y >= comp->height)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Watermark %s is outside of the %dx%d video.\n", spec, comp->width, comp->height);
+        wm_layer_free(layer);
+        return AVERROR(EINVAL);
+    }
+
+    if (g_str_has_prefix(layer->source, "text="))
+    {
+        layer->type = DEV189_WM_LAYER_IMAGE;
+        ret = wm_layer_set_text(comp, layer, layer->source + strlen("text="));
+    }
+    else if (g_str_has_prefix(layer->source, "time="))
+    {
+        char *format = g_strdup(layer->source + strlen("time="));
+        g_free(layer->source);
+        layer->source = format;
+        layer->type = DEV189_WM_LAYER_CLOCK;
+        ret = wm_layer_update_clock(comp, layer);
+    }
+    else
+    {
+        ret = wm_layer_load(layer);
+    }
+
+    if (ret < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Cannot add watermark %s.\n", spec);
+        wm_layer_free(layer);
+        return ret;
+    }
+    g_ptr_array_add(comp->layers, layer);
+
+    return 0;
+}
+
+int dev189_wm_compositor_prepare(t_dev189_wm_compositor *comp)
+{
+    int rect[4] = {INT_MAX, INT_MAX, 0, 0};
+    t_dev189_wm_layer *layer;
+
+    for (guint i = 0; i < comp->layers->len; i++)
+    {
+        layer = g_ptr_array_index(comp->layers, i);
+        if (layer->type == DEV189_WM_LAYER_IMAGE)
+            wm_rect_extend(comp, rect, layer->x + layer->offset.x, layer->y + layer->offset.y, layer->frame);
+    }
+
+    av_frame_free(&comp->flat);
+    if (rect[2] > rect[0] && rect[3] > rect[1])
+    {
+        if (!(comp->flat = wm_frame_alloc(rect[2] - rect[0], rect[3] - rect[1])))
+            return AVERROR(ENOMEM);
+        comp->flat_x = rect[0];
+        comp->flat_y = rect[1];
+    }
+
+    /*静态图层按添加顺序合并后不再需要，只保留动态图层*/
+    for (guint i = 0; i < comp->layers->len;)
+    {
+        layer = g_ptr_array_index(comp->layers, i);
+        if (layer->type != DEV189_WM_LAYER_IMAGE)
+        {
+            i++;
+            continue;
+        }
+        if (comp->flat)
+            wm_blend(comp->flat, layer->x + layer->offset.x - comp->flat_x,
+                     layer->y + layer->offset.y - comp->flat_y, layer->frame);
+        g_ptr_array_remove_index(comp->layers, i);
+    }
+    comp->dirty = TRUE;
+
+    return 0;
+}
+
+/*动态图层有变化时重新合成canvas，没有变化时直接复用*/
+static int wm_compositor_update(t_dev189_wm_compositor *comp, int64_t pts_ms)
+{
+    int ret, rect[4] = {INT_MAX, INT_MAX, 0, 0};
+    t_dev189_wm_layer *layer;
+
+    for (guint i = 0; i < comp->layers->len; i++)
+    {
+        layer = g_ptr_array_index(comp->layers, i);
+        if (layer->type == DEV189_WM_LAYER_ANIMATED)
+            wm_layer_update_animated(comp, layer, pts_ms);
+        else if (layer->type == DEV189_WM_LAYER_CLOCK && (ret = wm_layer_update_clock(comp, layer)) < 0)
+            return ret;
+    }
+    if (!comp->dirty)
+        return 0;
+
+    wm_rect_extend(comp, rect, comp->flat_x, comp->flat_y, comp->flat);
+    for (guint i = 0; i < comp->layers->len; i++)
+    {
+        layer = g_ptr_array_index(comp->layers, i);
+        wm_rect_extend(comp, rect, layer->x + layer->offset.x, layer->y + layer->offset.y, layer->frame);
+    }
+    if (rect[2] <= rect[0] || rect[3] <= rect[1])
+    {
+        av_frame_free(&comp->canvas);
+        comp->dirty = FALSE;
+        return 0;
+    }
+
+    if (comp->canvas && comp->canvas_x == rect[0] && comp->canvas_y == rect[1] &&
+        comp->canvas->width == FFALIGN(rect[2] - rect[0], 2) && comp->canvas->height == FFALIGN(rect[3] - rect[1], 2))
+    {
+        wm_frame_clear(comp->canvas);
+    }
+    else
+    {
+        av_frame_free(&comp->canvas);
+        if (!(comp->canvas = wm_frame_alloc(rect[2] - rect[0], rect[3] - rect[1])))
+            return AVERROR(ENOMEM);
+        comp->canvas_x = rect[0];
+        comp->canvas_y = rect[1];
+    }
+
+    if (comp->flat)
+        wm_blend(comp->canvas, comp->flat_x - comp->canvas_x, comp->flat_y - comp->canvas_y, comp->flat);
+    for (guint i = 0; i < comp->layers->len; i++)
+    {
+        layer = g_ptr_array_index(comp->layers, i);
+        wm_blend(comp->canvas, layer->x + layer->offset.x - comp->canvas_x,
+                 layer->y + layer->offset.y - comp->canvas_y, layer->frame);
+    }
+    comp->dirty = FALSE;
+
+    return 0;
+}
+
+int dev189_wm_compositor_apply(t_dev189_wm_compositor *comp, AVFrame *frame, int64_t pts_ms)
+{
+    int ret;
+
+    if (frame->format != AV_PIX_FMT_YUV420P)
+    {
+        av_log(NULL, AV_LOG_ERROR, "Watermark only supports yuv420p frames.\n");
+        return AVERROR(EINVAL);
+    }
+    if ((ret = wm_compositor_update(comp, pts_ms)) < 0)
+        return ret;
+    if (!comp->canvas)
+        return 0;
+    if ((ret = av_frame_make_writable(frame)) < 0)
+        return ret;
+
+    wm_blend(frame, comp->canvas_x, comp->canvas_y, comp->canvas);
+
+    return 0;
+}
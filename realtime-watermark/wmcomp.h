@@ -0,0 +1,83 @@
+/**
+ * 水印合成器
+ *
+ * 多个水印图层（静态图片、GIF/APNG动画、文字、时间角标）在启动时预先处理：
+ * 所有静态图层合并成一个预乘alpha的图层；动画图层的每一帧预先转换后循环使用；
+ * 文字图层只在内容变化时重新渲染。每个视频帧只需对图层并集区域做一次混合。
+ */
+#include <glib/glib.h>
+
+#include <libavfilter/avfilter.h>
+#include <libavutil/frame.h>
+
+/*图层类型*/
+typedef enum e_dev189_wm_layer_type
+{
+    DEV189_WM_LAYER_IMAGE,    // 静态图片或固定文字
+    DEV189_WM_LAYER_ANIMATED, // GIF/APNG动画
+    DEV189_WM_LAYER_CLOCK     // 按strftime格式显示的时间角标
+} t_dev189_wm_layer_type;
+
+/*帧在图层中的偏移，帧裁掉透明边缘后用来保持原来的位置*/
+typedef struct s_dev189_wm_point
+{
+    int x;
+    int y;
+} t_dev189_wm_point;
+
+typedef struct s_dev189_wm_layer
+{
+    t_dev189_wm_layer_type type;
+    char *source; // 文件名、文字或时间格式
+    int x;
+    int y;
+    AVFrame *frame;           // 当前显示的帧，预乘alpha的YUVA420P
+    t_dev189_wm_point offset; // 当前帧相对(x,y)的偏移
+    /*below are private fields*/
+    GPtrArray *frames;     // 动画帧缓存
+    GArray *offsets;       // 每个动画帧的偏移
+    GArray *starts;        // 每个动画帧的开始时间(ms)
+    int64_t loop_duration; // 动画循环一次的时长(ms)
+    guint current;         // 当前动画帧
+    char *text;            // 最近一次渲染的文字
+    AVFilterGraph *text_graph; // 文字图层的drawtext滤镜，只创建一次
+    AVFilterContext *text_src;
+    AVFilterContext *text_draw;
+    AVFilterContext *text_sink;
+    int64_t text_pts;
+    struct SwsContext *text_sws;
+} t_dev189_wm_layer;
+
+typedef struct s_dev189_wm_compositor
+{
+    int width;  // 视频宽度
+    int height; // 视频高度
+    GPtrArray *layers;
+    /*below are private fields*/
+    AVFrame *flat; // 合并后的静态图层
+    int flat_x;
+    int flat_y;
+    AVFrame *canvas; // 所有图层并集区域的合成结果
+    int canvas_x;
+    int canvas_y;
+    gboolean dirty; // 有图层变化，需要重新合成canvas
+} t_dev189_wm_compositor;
+
+t_dev189_wm_compositor *dev189_wm_compositor_new(int width, int height);
+
+void dev189_wm_compositor_free(t_dev189_wm_compositor *comp);
+
+/**
+ * 添加图层，格式为 <source>[@x,y]，默认位置为0,0，坐标向下对齐为偶数
+ *   logo.png / corner.gif  图片，多帧时作为动画循环播放
+ *   text=文字               固定文字
+ *   time=%H:%M:%S          时间角标，内容变化时才重新渲染
+ * 静态图层合并在动态图层下面。
+ */
+int dev189_wm_compositor_add(t_dev189_wm_compositor *comp, const char *spec);
+
+/*所有图层添加完成后调用，合并静态图层*/
+int dev189_wm_compositor_prepare(t_dev189_wm_compositor *comp);
+
+/*把水印混合到YUV420P帧上，pts_ms用于选择动画帧*/
+int dev189_wm_compositor_apply(t_dev189_wm_compositor *comp, AVFrame *frame, int64_t pts_ms);